@@ -28,6 +28,7 @@
 
 #include "color.hpp"
 #include "internal.hpp"
+#include "raster.hpp"
 #include "vector2d.hpp"
 #include "vector3d.hpp"
 
@@ -129,6 +130,9 @@ using vec3i_t = nmu::vec3_t<int>;
 
 using color_t = nmu::color_t;
 
+using canvas_t     = nmu::canvas_t;
+using rasterizer_t = nmu::rasterizer_t;
+
 #define m_pi_f nmu::constants::pi_number_f
 #define m_pi nmu::constants::pi_number
 
@@ -0,0 +1,1005 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2020 neg4n / Igor Klepacki
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#ifndef NMU_RASTER_HPP
+#define NMU_RASTER_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "color.hpp"
+#include "internal.hpp"
+#include "vector2d.hpp"
+
+namespace nmu {
+  namespace blend_modes {
+    constexpr inline int none = 0, alpha = 1;
+  }
+
+  /**
+   * ================================================
+   * Non-owning view over a buffer of color_t pixels.
+   * ================================================
+   */
+  struct canvas_t {
+    color_t * pixels = nullptr;
+    // Stride is expressed in pixels, 0 means the rows are tightly packed.
+    int width = 0, height = 0, stride = 0;
+
+    constexpr canvas_t( ) = default;
+    constexpr canvas_t( color_t * pixels, int width, int height, int stride = 0 )
+        : pixels( pixels ), width( width ), height( height ), stride( stride != 0 ? stride : width ) { };
+
+    [[nodiscard]] color_t & at( int x, int y ) const noexcept {
+      nmu_assert( x >= 0 && x < width && y >= 0 && y < height, "Pixel is out of canvas bounds" );
+      return pixels[ static_cast<std::size_t>( y ) * stride + x ];
+    }
+  };
+} // namespace nmu
+
+// Precedes the block_size wide lane loops, at -O3 GCC fully unrolls them
+// before vectorization and then leaves the unrolled code scalar. The pragma
+// exists since GCC 8, other compilers get the empty definition.
+#if defined( __GNUC__ ) && !defined( __clang__ ) && __GNUC__ >= 8
+#define nmu_lane_loop _Pragma( "GCC unroll 1" )
+#else
+#define nmu_lane_loop
+#endif
+
+// DO NOT USE outside nmu.hpp
+namespace _nmu_internal {
+  // Triangle vertices are snapped to 1/16th of a pixel before rasterization.
+  constexpr inline int subpixel_bits = 4;
+  constexpr inline int subpixel_half = 1 << ( subpixel_bits - 1 );
+  // Coordinates and radii are limited to [-max_coordinate; max_coordinate] pixels,
+  // which keeps the subpixel edge functions and squared radii far from overflow.
+  constexpr inline int max_coordinate = 1 << 17;
+  // Triangles are walked in blocks of block_size x block_size pixels,
+  // edge functions inside a block are evaluated for a whole row at once.
+  constexpr inline int block_size = 8;
+
+  // Pixel rectangle, min is inclusive and max is exclusive.
+  struct clip_rect_t {
+    int min_x = 0, min_y = 0, max_x = 0, max_y = 0;
+  };
+
+  template <typename T> [[nodiscard]] inline bool in_range( T value ) noexcept {
+    // Written so that NaN is out of range as well.
+    return value >= -max_coordinate && value <= max_coordinate;
+  }
+
+  template <typename T> [[nodiscard]] inline bool in_range( const nmu::vec2_t<T> & v ) noexcept {
+    return in_range( v.x ) && in_range( v.y );
+  }
+
+  [[nodiscard]] inline clip_rect_t canvas_rect( const nmu::canvas_t & canvas ) noexcept {
+    return clip_rect_t { 0, 0, canvas.width, canvas.height };
+  }
+
+  inline void write_pixel( nmu::color_t & dst, const nmu::color_t & src, int blend ) noexcept {
+    if ( blend != nmu::blend_modes::alpha || src.a == 255 ) {
+      dst = src;
+      return;
+    }
+
+    if ( src.a == 0 )
+      return;
+
+    // Rounded (src * a + dst * (255 - a)) / 255 without the division.
+    const auto mix = [ inv = 255 - src.a, a = src.a ]( int s, int d ) {
+      const int v = s * a + d * inv + 128;
+      return static_cast<std::uint8_t>( ( v + ( v >> 8 ) ) >> 8 );
+    };
+
+    dst.r = mix( src.r, dst.r );
+    dst.g = mix( src.g, dst.g );
+    dst.b = mix( src.b, dst.b );
+    dst.a = mix( 255, dst.a );
+  }
+
+  /**
+   * Writes color into the block_size pixels whose mask lane is non-negative.
+   * Uses selects on packed pixels instead of per pixel branches so that the
+   * whole row is vectorized, the blending matches write_pixel exactly.
+   */
+  inline void write_masked( nmu::color_t *       pixels,
+                            const std::int32_t * mask,
+                            const nmu::color_t & color,
+                            int                  blend ) noexcept {
+    static_assert( sizeof( nmu::color_t ) == sizeof( std::uint32_t ), "color_t must be 4 packed channels" );
+
+    if ( blend == nmu::blend_modes::alpha && color.a == 0 )
+      return;
+
+    std::uint32_t row[ block_size ];
+    std::memcpy( row, pixels, sizeof( row ) );
+
+    if ( blend != nmu::blend_modes::alpha || color.a == 255 ) {
+      std::uint32_t packed;
+      std::memcpy( &packed, &color, sizeof( packed ) );
+
+      nmu_lane_loop
+      for ( int i = 0; i < block_size; ++i )
+        row[ i ] = mask[ i ] >= 0 ? packed : row[ i ];
+    } else {
+      // The alpha channel blends towards 255, the same as in write_pixel.
+      const nmu::color_t opaque( color.r, color.g, color.b, 255 );
+      std::uint32_t      packed;
+      std::memcpy( &packed, &opaque, sizeof( packed ) );
+
+      // Two channels per word in 16-bit fields, src * a + dst * inv + 128 peaks
+      // at 65153 so neither the sum nor the rounding carries into the next field.
+      constexpr std::uint32_t fields  = 0x00ff00ffu;
+      const std::uint32_t     inv     = 255u - color.a;
+      const std::uint32_t     bias_lo = ( packed & fields ) * color.a + 0x00800080u;
+      const std::uint32_t     bias_hi = ( ( packed >> 8 ) & fields ) * color.a + 0x00800080u;
+
+      nmu_lane_loop
+      for ( int i = 0; i < block_size; ++i ) {
+        const std::uint32_t lo = ( row[ i ] & fields ) * inv + bias_lo;
+        const std::uint32_t hi = ( ( row[ i ] >> 8 ) & fields ) * inv + bias_hi;
+
+        const std::uint32_t blended = ( ( ( lo + ( ( lo >> 8 ) & fields ) ) >> 8 ) & fields ) |
+                                      ( ( hi + ( ( hi >> 8 ) & fields ) ) & ~fields );
+
+        row[ i ] = mask[ i ] >= 0 ? blended : row[ i ];
+      }
+    }
+
+    std::memcpy( pixels, row, sizeof( row ) );
+  }
+
+  inline void plot( const nmu::canvas_t & canvas,
+                    const clip_rect_t &  clip,
+                    int                  x,
+                    int                  y,
+                    const nmu::color_t & color,
+                    int                  blend ) noexcept {
+    if ( x < clip.min_x || x >= clip.max_x || y < clip.min_y || y >= clip.max_y )
+      return;
+
+    write_pixel( canvas.at( x, y ), color, blend );
+  }
+
+  // Fills pixels [x0; x1) of row y.
+  inline void span( const nmu::canvas_t & canvas,
+                    const clip_rect_t &  clip,
+                    int                  y,
+                    int                  x0,
+                    int                  x1,
+                    const nmu::color_t & color,
+                    int                  blend ) noexcept {
+    if ( y < clip.min_y || y >= clip.max_y )
+      return;
+
+    x0 = std::max( x0, clip.min_x );
+    x1 = std::min( x1, clip.max_x );
+    if ( x0 >= x1 )
+      return;
+
+    nmu::color_t * row = &canvas.at( x0, y );
+    for ( int i = 0; i < x1 - x0; ++i )
+      write_pixel( row[ i ], color, blend );
+  }
+
+  // Floor and ceil of a / b for b > 0.
+  [[nodiscard]] constexpr std::int64_t floor_div( std::int64_t a, std::int64_t b ) noexcept {
+    return a >= 0 ? a / b : -( ( -a + b - 1 ) / b );
+  }
+
+  [[nodiscard]] constexpr std::int64_t ceil_div( std::int64_t a, std::int64_t b ) noexcept {
+    return -floor_div( -a, b );
+  }
+
+  /**
+   * Integer line from a to b, both endpoints included. Step i along the
+   * major axis moves round( i * minor_length / major_length ) pixels along
+   * the minor axis, so the line can be entered at any step, which is what
+   * clipping it to a tile needs.
+   */
+  struct line_walk_t {
+    bool         steep;
+    int          major_origin, minor_origin, major_sign, minor_sign;
+    std::int64_t major_length, minor_length;
+
+    line_walk_t( const nmu::vec2_t<int> & a, const nmu::vec2_t<int> & b ) noexcept
+        : steep( std::abs( b.y - a.y ) > std::abs( b.x - a.x ) ),
+          major_origin( steep ? a.y : a.x ),
+          minor_origin( steep ? a.x : a.y ),
+          major_sign( ( steep ? b.y - a.y : b.x - a.x ) < 0 ? -1 : 1 ),
+          minor_sign( ( steep ? b.x - a.x : b.y - a.y ) < 0 ? -1 : 1 ),
+          major_length( std::abs( steep ? b.y - a.y : b.x - a.x ) ),
+          minor_length( std::abs( steep ? b.x - a.x : b.y - a.y ) ) { };
+
+    // Range of steps whose pixels fall into clip, first > last when there are none.
+    [[nodiscard]] std::pair<std::int64_t, std::int64_t>
+    clip_steps( const clip_rect_t & clip ) const noexcept {
+      // Offsets q for which origin + sign * q lies in [min; max).
+      const auto offsets = []( int origin, int sign, int min, int max ) {
+        return sign > 0 ? std::make_pair<std::int64_t, std::int64_t>( min - origin, max - 1 - origin )
+                        : std::make_pair<std::int64_t, std::int64_t>( origin - ( max - 1 ), origin - min );
+      };
+
+      const auto [ major_lo, major_hi ] = offsets( major_origin,
+                                                   major_sign,
+                                                   steep ? clip.min_y : clip.min_x,
+                                                   steep ? clip.max_y : clip.max_x );
+      const auto [ minor_lo, minor_hi ] = offsets( minor_origin,
+                                                   minor_sign,
+                                                   steep ? clip.min_x : clip.min_y,
+                                                   steep ? clip.max_x : clip.max_y );
+
+      std::int64_t first = std::max<std::int64_t>( 0, major_lo ), last = std::min( major_length, major_hi );
+      if ( minor_length == 0 ) {
+        if ( minor_lo > 0 || minor_hi < 0 )
+          return { 1, 0 };
+      } else {
+        // Inverse of the minor offset rounding, see minor_offset( ).
+        const std::int64_t lo_numerator = 2 * major_length * minor_lo - major_length;
+        const std::int64_t hi_numerator = 2 * major_length * ( minor_hi + 1 ) - major_length - 1;
+
+        first = std::max( first, ceil_div( lo_numerator, 2 * minor_length ) );
+        last  = std::min( last, floor_div( hi_numerator, 2 * minor_length ) );
+      }
+      return { first, last };
+    }
+
+    [[nodiscard]] std::int64_t minor_offset( std::int64_t step ) const noexcept {
+      return major_length == 0 ? 0 : ( 2 * step * minor_length + major_length ) / ( 2 * major_length );
+    }
+
+    [[nodiscard]] nmu::vec2_t<int> pixel( std::int64_t step ) const noexcept {
+      const int major = major_origin + major_sign * static_cast<int>( step );
+      const int minor = minor_origin + minor_sign * static_cast<int>( minor_offset( step ) );
+      return steep ? nmu::vec2_t<int> { minor, major } : nmu::vec2_t<int> { major, minor };
+    }
+  };
+
+  // Only the part of the line inside clip is walked.
+  inline void line( const nmu::canvas_t &    canvas,
+                    const clip_rect_t &      clip,
+                    const nmu::vec2_t<int> & a,
+                    const nmu::vec2_t<int> & b,
+                    const nmu::color_t &     color,
+                    int                      blend ) noexcept {
+    nmu_assert( in_range( a ) && in_range( b ), "Line endpoint is out of range" );
+
+    const line_walk_t walk( a, b );
+    const auto [ first, last ] = walk.clip_steps( clip );
+    if ( first > last )
+      return;
+
+    // Minor offset kept as quotient and remainder of the rounding division.
+    const std::int64_t denominator = std::max<std::int64_t>( 2 * walk.major_length, 1 );
+    const std::int64_t numerator   = 2 * first * walk.minor_length + walk.major_length;
+    std::int64_t       offset = numerator / denominator, remainder = numerator % denominator;
+
+    for ( std::int64_t step = first; step <= last; ++step ) {
+      const int major = walk.major_origin + walk.major_sign * static_cast<int>( step );
+      const int minor = walk.minor_origin + walk.minor_sign * static_cast<int>( offset );
+      write_pixel( walk.steep ? canvas.at( minor, major ) : canvas.at( major, minor ), color, blend );
+
+      remainder += 2 * walk.minor_length;
+      if ( remainder >= denominator ) {
+        remainder -= denominator;
+        ++offset;
+      }
+    }
+  }
+
+  // Xiaolin Wu's antialiased line, coverage is always alpha blended.
+  inline void line_aa( const nmu::canvas_t &      canvas,
+                       const clip_rect_t &        clip,
+                       const nmu::vec2_t<float> & a,
+                       const nmu::vec2_t<float> & b,
+                       const nmu::color_t &       color ) noexcept {
+    nmu_assert( in_range( a ) && in_range( b ), "Line endpoint is out of range" );
+
+    float x0 = a.x, y0 = a.y, x1 = b.x, y1 = b.y;
+
+    const bool steep = std::abs( y1 - y0 ) > std::abs( x1 - x0 );
+    if ( steep ) {
+      std::swap( x0, y0 );
+      std::swap( x1, y1 );
+    }
+    if ( x0 > x1 ) {
+      std::swap( x0, x1 );
+      std::swap( y0, y1 );
+    }
+
+    const float dx       = x1 - x0;
+    const float gradient = dx == 0.f ? 1.f : ( y1 - y0 ) / dx;
+
+    const auto fract         = []( float v ) { return v - std::floor( v ); };
+    const auto plot_coverage = [ & ]( int x, int y, float coverage ) {
+      nmu::color_t covered = color;
+      covered.a            = static_cast<std::uint8_t>( color.a * coverage + 0.5f );
+      if ( steep )
+        plot( canvas, clip, y, x, covered, nmu::blend_modes::alpha );
+      else
+        plot( canvas, clip, x, y, covered, nmu::blend_modes::alpha );
+    };
+
+    if ( std::round( x0 ) == std::round( x1 ) ) {
+      // Both endpoints land in the same pixel column, plot it once with
+      // coverage scaled by the length of the segment.
+      const float y_mid = ( y0 + y1 ) * 0.5f;
+      const int   x     = static_cast<int>( std::round( x0 ) );
+      const int   y     = static_cast<int>( std::floor( y_mid ) );
+      plot_coverage( x, y, ( 1.f - fract( y_mid ) ) * dx );
+      plot_coverage( x, y + 1, fract( y_mid ) * dx );
+      return;
+    }
+
+    float     x_end   = std::round( x0 );
+    float     y_end   = y0 + gradient * ( x_end - x0 );
+    float     x_gap   = 1.f - fract( x0 + 0.5f );
+    const int x_first = static_cast<int>( x_end );
+    int       y_pixel = static_cast<int>( std::floor( y_end ) );
+    plot_coverage( x_first, y_pixel, ( 1.f - fract( y_end ) ) * x_gap );
+    plot_coverage( x_first, y_pixel + 1, fract( y_end ) * x_gap );
+
+    const float y_first = y_end;
+
+    x_end            = std::round( x1 );
+    y_end            = y1 + gradient * ( x_end - x1 );
+    x_gap            = fract( x1 + 0.5f );
+    const int x_last = static_cast<int>( x_end );
+    y_pixel          = static_cast<int>( std::floor( y_end ) );
+    plot_coverage( x_last, y_pixel, ( 1.f - fract( y_end ) ) * x_gap );
+    plot_coverage( x_last, y_pixel + 1, fract( y_end ) * x_gap );
+
+    // Only walk the columns whose pixels can meet clip. The minor position is
+    // computed from the column, so every clip rectangle sees the same values.
+    const int major_min = steep ? clip.min_y : clip.min_x, major_max = steep ? clip.max_y : clip.max_x;
+    const int minor_min = steep ? clip.min_x : clip.min_y, minor_max = steep ? clip.max_x : clip.max_y;
+
+    float first = std::max( static_cast<float>( x_first + 1 ), static_cast<float>( major_min ) );
+    float last  = std::min( static_cast<float>( x_last - 1 ), static_cast<float>( major_max - 1 ) );
+    if ( gradient != 0.f ) {
+      const float at_min = x_first + ( minor_min - 1 - y_first ) / gradient;
+      const float at_max = x_first + ( minor_max - y_first ) / gradient;
+      first              = std::max( first, std::floor( std::min( at_min, at_max ) ) - 1.f );
+      last               = std::min( last, std::ceil( std::max( at_min, at_max ) ) + 1.f );
+    }
+    if ( first > last )
+      return;
+
+    for ( int x = static_cast<int>( first ); x <= static_cast<int>( last ); ++x ) {
+      const float inter_y = y_first + gradient * static_cast<float>( x - x_first );
+      const int   y       = static_cast<int>( std::floor( inter_y ) );
+      plot_coverage( x, y, 1.f - fract( inter_y ) );
+      plot_coverage( x, y + 1, fract( inter_y ) );
+    }
+  }
+
+  [[nodiscard]] inline nmu::vec2_t<int> to_subpixel( const nmu::vec2_t<int> & v ) noexcept {
+    nmu_assert( in_range( v ), "Triangle vertex is out of range" );
+    return nmu::vec2_t<int> { v.x * ( 1 << subpixel_bits ), v.y * ( 1 << subpixel_bits ) };
+  }
+
+  [[nodiscard]] inline nmu::vec2_t<int> to_subpixel( const nmu::vec2_t<float> & v ) noexcept {
+    constexpr float scale = static_cast<float>( 1 << subpixel_bits );
+    nmu_assert( in_range( v ), "Triangle vertex is out of range" );
+    return nmu::vec2_t<int> { static_cast<int>( std::lround( v.x * scale ) ),
+                              static_cast<int>( std::lround( v.y * scale ) ) };
+  }
+
+  /**
+   * Half-space triangle fill, vertices are in subpixel units (see to_subpixel).
+   * A pixel is filled when its center lies inside the triangle, shared edges
+   * follow the top-left rule so adjacent triangles never overlap.
+   */
+  inline void triangle( const nmu::canvas_t &    canvas,
+                        const clip_rect_t &      clip,
+                        const nmu::vec2_t<int> & v0,
+                        const nmu::vec2_t<int> & v1,
+                        const nmu::vec2_t<int> & v2,
+                        const nmu::color_t &     color,
+                        int                      blend ) noexcept {
+    using edge_value_t = std::int64_t;
+
+    const auto orient = []( const nmu::vec2_t<int> & a,
+                            const nmu::vec2_t<int> & b,
+                            edge_value_t             x,
+                            edge_value_t             y ) {
+      return static_cast<edge_value_t>( b.x - a.x ) * ( y - a.y ) -
+             static_cast<edge_value_t>( b.y - a.y ) * ( x - a.x );
+    };
+
+    const edge_value_t area = orient( v0, v1, v2.x, v2.y );
+    if ( area == 0 )
+      return;
+    // Wind the triangle so that the inside is where every edge function is positive.
+    const nmu::vec2_t<int> *p1 = &v1, *p2 = &v2;
+    if ( area < 0 )
+      std::swap( p1, p2 );
+
+    // Pixels whose centers fall inside the bounding box, clipped.
+    constexpr int up = ( 1 << subpixel_bits ) - 1; // Rounds the min corner up to a whole pixel.
+
+    const int min_x =
+        std::max( clip.min_x, ( std::min( { v0.x, v1.x, v2.x } ) - subpixel_half + up ) >> subpixel_bits );
+    const int min_y =
+        std::max( clip.min_y, ( std::min( { v0.y, v1.y, v2.y } ) - subpixel_half + up ) >> subpixel_bits );
+    const int max_x =
+        std::min( clip.max_x, ( ( std::max( { v0.x, v1.x, v2.x } ) - subpixel_half ) >> subpixel_bits ) + 1 );
+    const int max_y =
+        std::min( clip.max_y, ( ( std::max( { v0.y, v1.y, v2.y } ) - subpixel_half ) >> subpixel_bits ) + 1 );
+    if ( min_x >= max_x || min_y >= max_y )
+      return;
+
+    const edge_value_t origin_x = static_cast<edge_value_t>( min_x ) * ( 1 << subpixel_bits ) + subpixel_half;
+    const edge_value_t origin_y = static_cast<edge_value_t>( min_y ) * ( 1 << subpixel_bits ) + subpixel_half;
+
+    // Edge functions at the first pixel center and their per-pixel increments.
+    edge_value_t row[ 3 ], step_x[ 3 ], step_y[ 3 ];
+    const nmu::vec2_t<int> * edges[ 3 ][ 2 ] = { { p1, p2 }, { p2, &v0 }, { &v0, p1 } };
+    for ( int i = 0; i < 3; ++i ) {
+      const nmu::vec2_t<int> & a = *edges[ i ][ 0 ];
+      const nmu::vec2_t<int> & b = *edges[ i ][ 1 ];
+
+      const bool is_top_left = ( a.y == b.y && b.x > a.x ) || b.y < a.y;
+
+      row[ i ]    = orient( a, b, origin_x, origin_y ) - ( is_top_left ? 0 : 1 );
+      step_x[ i ] = static_cast<edge_value_t>( a.y - b.y ) * ( 1 << subpixel_bits );
+      step_y[ i ] = static_cast<edge_value_t>( b.x - a.x ) * ( 1 << subpixel_bits );
+    }
+
+    /**
+     * Inside a partially covered block only the edges crossing it are tested,
+     * their values there stay below 28 * 2^26 for coordinates within
+     * max_coordinate, so the row test runs on 32-bit lanes. Edges that the
+     * whole block passes are replaced by far_inside, which the lane offsets
+     * (below 7 * 2^26) can not bring to a negative value.
+     */
+    constexpr std::int32_t far_inside = 1 << 30;
+
+    std::int32_t lane_x[ 3 ][ block_size ];
+    for ( int i = 0; i < 3; ++i )
+      for ( int lane = 0; lane < block_size; ++lane )
+        lane_x[ i ][ lane ] = static_cast<std::int32_t>( step_x[ i ] * lane );
+
+    for ( int block_y = min_y; block_y < max_y; block_y += block_size ) {
+      const int    block_h    = std::min( block_size, max_y - block_y );
+      edge_value_t block[ 3 ] = { row[ 0 ], row[ 1 ], row[ 2 ] };
+
+      for ( int block_x = min_x; block_x < max_x; block_x += block_size ) {
+        const int block_w = std::min( block_size, max_x - block_x );
+
+        // Edge functions are linear, so the block corners bound them.
+        bool rejected = false, covered = true, edge_covered[ 3 ];
+        for ( int i = 0; i < 3; ++i ) {
+          const edge_value_t c00 = block[ i ];
+          const edge_value_t c10 = c00 + step_x[ i ] * ( block_w - 1 );
+          const edge_value_t c01 = c00 + step_y[ i ] * ( block_h - 1 );
+          const edge_value_t c11 = c10 + step_y[ i ] * ( block_h - 1 );
+
+          if ( std::max( { c00, c10, c01, c11 } ) < 0 )
+            rejected = true;
+          edge_covered[ i ] = std::min( { c00, c10, c01, c11 } ) >= 0;
+          covered           = covered && edge_covered[ i ];
+        }
+
+        if ( rejected ) {
+          // Nothing to draw.
+        } else if ( covered ) {
+          for ( int y = 0; y < block_h; ++y )
+            span( canvas, clip, block_y + y, block_x, block_x + block_w, color, blend );
+        } else {
+          // Edge values of the current block row, one lane per pixel.
+          std::int32_t w0[ block_size ], w1[ block_size ], w2[ block_size ], w_step[ 3 ];
+          std::int32_t w_origin[ 3 ];
+          for ( int i = 0; i < 3; ++i ) {
+            w_origin[ i ] = edge_covered[ i ] ? far_inside : static_cast<std::int32_t>( block[ i ] );
+            w_step[ i ]   = edge_covered[ i ] ? 0 : static_cast<std::int32_t>( step_y[ i ] );
+          }
+          nmu_lane_loop
+          for ( int i = 0; i < block_size; ++i ) {
+            w0[ i ] = w_origin[ 0 ] + lane_x[ 0 ][ i ];
+            w1[ i ] = w_origin[ 1 ] + lane_x[ 1 ][ i ];
+            w2[ i ] = w_origin[ 2 ] + lane_x[ 2 ][ i ];
+          }
+
+          for ( int y = 0; y < block_h; ++y ) {
+            // Whole row of the block at once, the sign bit of the OR is set
+            // when the pixel center is outside of any edge.
+            std::int32_t mask[ block_size ];
+            nmu_lane_loop
+            for ( int i = 0; i < block_size; ++i )
+              mask[ i ] = w0[ i ] | w1[ i ] | w2[ i ];
+
+            nmu::color_t * pixels = &canvas.at( block_x, block_y + y );
+            if ( block_w == block_size ) {
+              write_masked( pixels, mask, color, blend );
+            } else {
+              for ( int i = 0; i < block_w; ++i )
+                if ( mask[ i ] >= 0 )
+                  write_pixel( pixels[ i ], color, blend );
+            }
+
+            nmu_lane_loop
+            for ( int i = 0; i < block_size; ++i ) {
+              w0[ i ] += w_step[ 0 ];
+              w1[ i ] += w_step[ 1 ];
+              w2[ i ] += w_step[ 2 ];
+            }
+          }
+        }
+
+        for ( int i = 0; i < 3; ++i )
+          block[ i ] += step_x[ i ] * block_size;
+      }
+
+      for ( int i = 0; i < 3; ++i )
+        row[ i ] += step_y[ i ] * block_size;
+    }
+  }
+
+  // Largest x with x * x + y * y <= limit, -1 when row y misses the circle.
+  [[nodiscard]] inline std::int64_t circle_half_width( std::int64_t limit, std::int64_t y ) noexcept {
+    const std::int64_t rest = limit - y * y;
+    if ( rest < 0 )
+      return -1;
+
+    auto x = static_cast<std::int64_t>( std::sqrt( static_cast<double>( rest ) ) );
+    while ( x * x > rest )
+      --x;
+    while ( ( x + 1 ) * ( x + 1 ) <= rest )
+      ++x;
+    return x;
+  }
+
+  // Pixel rows of the circle meeting clip, relative to the center.
+  [[nodiscard]] inline std::pair<int, int>
+  circle_rows( const clip_rect_t & clip, const nmu::vec2_t<int> & center, int radius ) noexcept {
+    return { std::max( -radius, clip.min_y - center.y ), std::min( radius, clip.max_y - 1 - center.y ) };
+  }
+
+  /**
+   * Circle outline, the pixels of the circle_filled disk that have a
+   * neighbour outside of it. Each pixel is written exactly once.
+   */
+  inline void circle( const nmu::canvas_t &    canvas,
+                      const clip_rect_t &      clip,
+                      const nmu::vec2_t<int> & center,
+                      int                      radius,
+                      const nmu::color_t &     color,
+                      int                      blend ) noexcept {
+    nmu_assert( in_range( center ) && in_range( radius ), "Circle is out of range" );
+    if ( radius < 0 )
+      return;
+
+    const std::int64_t limit          = static_cast<std::int64_t>( radius ) * radius + radius;
+    const auto [ first_row, last_row ] = circle_rows( clip, center, radius );
+    for ( int y = first_row; y <= last_row; ++y ) {
+      const int outer = static_cast<int>( circle_half_width( limit, y ) );
+      // The row further from the center bounds where the outline starts.
+      const int next  = static_cast<int>( circle_half_width( limit, std::abs( y ) + 1 ) );
+      const int inner = std::min( outer, next + 1 );
+
+      if ( inner == 0 ) {
+        span( canvas, clip, center.y + y, center.x - outer, center.x + outer + 1, color, blend );
+      } else {
+        span( canvas, clip, center.y + y, center.x - outer, center.x - inner + 1, color, blend );
+        span( canvas, clip, center.y + y, center.x + inner, center.x + outer + 1, color, blend );
+      }
+    }
+  }
+
+  // Filled circle as one horizontal span per row.
+  inline void circle_filled( const nmu::canvas_t &    canvas,
+                             const clip_rect_t &      clip,
+                             const nmu::vec2_t<int> & center,
+                             int                      radius,
+                             const nmu::color_t &     color,
+                             int                      blend ) noexcept {
+    nmu_assert( in_range( center ) && in_range( radius ), "Circle is out of range" );
+    if ( radius < 0 )
+      return;
+
+    const std::int64_t limit          = static_cast<std::int64_t>( radius ) * radius + radius;
+    const auto [ first_row, last_row ] = circle_rows( clip, center, radius );
+    for ( int y = first_row; y <= last_row; ++y ) {
+      const int half_width = static_cast<int>( circle_half_width( limit, y ) );
+      span( canvas, clip, center.y + y, center.x - half_width, center.x + half_width + 1, color, blend );
+    }
+  }
+} // namespace _nmu_internal
+
+namespace nmu {
+  /**
+   * Immediate drawing into a canvas. Integer coordinates
+   * address pixels, triangle vertices address pixel corners.
+   * Coordinates and radii must stay within +-131072 pixels.
+   * --------------------------------------------------------
+   */
+
+  inline void draw_line( const canvas_t &    canvas,
+                         const vec2_t<int> & a,
+                         const vec2_t<int> & b,
+                         const color_t &     color,
+                         int                 blend = blend_modes::alpha ) noexcept {
+    _nmu_internal::line( canvas, _nmu_internal::canvas_rect( canvas ), a, b, color, blend );
+  }
+
+  inline void draw_line_aa( const canvas_t &      canvas,
+                            const vec2_t<float> & a,
+                            const vec2_t<float> & b,
+                            const color_t &       color ) noexcept {
+    _nmu_internal::line_aa( canvas, _nmu_internal::canvas_rect( canvas ), a, b, color );
+  }
+
+  template <typename T>
+  inline void fill_triangle( const canvas_t &  canvas,
+                             const vec2_t<T> & a,
+                             const vec2_t<T> & b,
+                             const vec2_t<T> & c,
+                             const color_t &   color,
+                             int               blend = blend_modes::alpha ) noexcept {
+    static_assert( std::is_same<T, int>::value || std::is_same<T, float>::value,
+                   "Type must be int or float" );
+
+    _nmu_internal::triangle( canvas,
+                             _nmu_internal::canvas_rect( canvas ),
+                             _nmu_internal::to_subpixel( a ),
+                             _nmu_internal::to_subpixel( b ),
+                             _nmu_internal::to_subpixel( c ),
+                             color,
+                             blend );
+  }
+
+  inline void draw_circle( const canvas_t &    canvas,
+                           const vec2_t<int> & center,
+                           int                 radius,
+                           const color_t &     color,
+                           int                 blend = blend_modes::alpha ) noexcept {
+    _nmu_internal::circle( canvas, _nmu_internal::canvas_rect( canvas ), center, radius, color, blend );
+  }
+
+  inline void fill_circle( const canvas_t &    canvas,
+                           const vec2_t<int> & center,
+                           int                 radius,
+                           const color_t &     color,
+                           int                 blend = blend_modes::alpha ) noexcept {
+    _nmu_internal::circle_filled(
+        canvas, _nmu_internal::canvas_rect( canvas ), center, radius, color, blend );
+  }
+
+  /**
+   * =====================================================
+   * Deferred rasterizer, primitives are binned into
+   * square tiles and drawn on flush( ), tiles are
+   * independent so they are spread over worker threads.
+   * Primitives keep their submission order in each tile.
+   * Drawing methods mirror the immediate functions above.
+   * =====================================================
+   */
+  struct rasterizer_t {
+    explicit rasterizer_t( const canvas_t & canvas, int tile_size = 64 )
+        : m_canvas( canvas ),
+          m_tile_size( round_tile_size( tile_size ) ),
+          m_tiles_x( ( canvas.width + m_tile_size - 1 ) / m_tile_size ),
+          m_tiles_y( ( canvas.height + m_tile_size - 1 ) / m_tile_size ),
+          m_bins( static_cast<std::size_t>( m_tiles_x ) * m_tiles_y ) { };
+
+    void draw_line( const vec2_t<int> & a,
+                    const vec2_t<int> & b,
+                    const color_t &     color,
+                    int                 blend = blend_modes::alpha ) {
+      nmu_assert( _nmu_internal::in_range( a ) && _nmu_internal::in_range( b ),
+                  "Line endpoint is out of range" );
+
+      primitive_t & primitive = push( primitive_types::line, color, blend );
+      primitive.points[ 0 ]   = a;
+      primitive.points[ 1 ]   = b;
+
+      // Per row of tiles, bin only the columns between the first and last pixel in it.
+      const _nmu_internal::line_walk_t walk( a, b );
+      const auto [ first_row, last_row ] =
+          tile_span( std::min( a.y, b.y ), std::max( a.y, b.y ), m_canvas.height );
+      for ( int tile_y = first_row; tile_y <= last_row; ++tile_y ) {
+        const auto [ first, last ] = walk.clip_steps( tile_row_rect( tile_y ) );
+        if ( first > last )
+          continue;
+
+        const int x0 = walk.pixel( first ).x, x1 = walk.pixel( last ).x;
+        bin_row( tile_y, std::min( x0, x1 ), std::max( x0, x1 ) );
+      }
+    }
+
+    void draw_line_aa( const vec2_t<float> & a, const vec2_t<float> & b, const color_t & color ) {
+      nmu_assert( _nmu_internal::in_range( a ) && _nmu_internal::in_range( b ),
+                  "Line endpoint is out of range" );
+
+      primitive_t & primitive = push( primitive_types::line_aa, color, blend_modes::alpha );
+      primitive.points_f[ 0 ] = a;
+      primitive.points_f[ 1 ] = b;
+
+      // Wu's lines stay within pad pixels of the ideal segment, per row of tiles
+      // bin the columns spanned by the part of the segment near that row.
+      constexpr float pad                = 2.f;
+      const auto [ first_row, last_row ] =
+          tile_span( static_cast<int>( std::floor( std::min( a.y, b.y ) - pad ) ),
+                     static_cast<int>( std::ceil( std::max( a.y, b.y ) + pad ) ),
+                     m_canvas.height );
+      for ( int tile_y = first_row; tile_y <= last_row; ++tile_y ) {
+        const _nmu_internal::clip_rect_t row = tile_row_rect( tile_y );
+
+        float t0 = 0.f, t1 = 1.f;
+        if ( a.y != b.y ) {
+          const float ta = ( row.min_y - pad - a.y ) / ( b.y - a.y );
+          const float tb = ( row.max_y + pad - a.y ) / ( b.y - a.y );
+          t0             = std::max( t0, std::min( ta, tb ) );
+          t1             = std::min( t1, std::max( ta, tb ) );
+          if ( t0 > t1 )
+            continue;
+        }
+
+        const float x0 = a.x + ( b.x - a.x ) * t0, x1 = a.x + ( b.x - a.x ) * t1;
+        bin_row( tile_y,
+                 static_cast<int>( std::floor( std::min( x0, x1 ) - pad ) ),
+                 static_cast<int>( std::ceil( std::max( x0, x1 ) + pad ) ) );
+      }
+    }
+
+    template <typename T>
+    void fill_triangle( const vec2_t<T> & a,
+                        const vec2_t<T> & b,
+                        const vec2_t<T> & c,
+                        const color_t &   color,
+                        int               blend = blend_modes::alpha ) {
+      static_assert( std::is_same<T, int>::value || std::is_same<T, float>::value,
+                     "Type must be int or float" );
+
+      primitive_t & primitive = push( primitive_types::triangle, color, blend );
+      primitive.points[ 0 ]   = _nmu_internal::to_subpixel( a );
+      primitive.points[ 1 ]   = _nmu_internal::to_subpixel( b );
+      primitive.points[ 2 ]   = _nmu_internal::to_subpixel( c );
+
+      const vec2_t<int> * points = primitive.points;
+      bin( std::min( { points[ 0 ].x, points[ 1 ].x, points[ 2 ].x } ) >> _nmu_internal::subpixel_bits,
+           std::min( { points[ 0 ].y, points[ 1 ].y, points[ 2 ].y } ) >> _nmu_internal::subpixel_bits,
+           std::max( { points[ 0 ].x, points[ 1 ].x, points[ 2 ].x } ) >> _nmu_internal::subpixel_bits,
+           std::max( { points[ 0 ].y, points[ 1 ].y, points[ 2 ].y } ) >> _nmu_internal::subpixel_bits );
+    }
+
+    void draw_circle( const vec2_t<int> & center,
+                      int                 radius,
+                      const color_t &     color,
+                      int                 blend = blend_modes::alpha ) {
+      push_circle( primitive_types::circle, center, radius, color, blend );
+    }
+
+    void fill_circle( const vec2_t<int> & center,
+                      int                 radius,
+                      const color_t &     color,
+                      int                 blend = blend_modes::alpha ) {
+      push_circle( primitive_types::circle_filled, center, radius, color, blend );
+    }
+
+    /**
+     * Draws every queued primitive and clears the queue,
+     * thread_count == 0 uses all hardware threads.
+     * --------------------------------------------------
+     */
+
+    void flush( unsigned thread_count = 0 ) {
+      if ( thread_count == 0 )
+        thread_count = std::max( 1u, std::thread::hardware_concurrency( ) );
+
+      const std::size_t        tile_count = m_bins.size( );
+      std::atomic<std::size_t> next_tile { 0 };
+
+      const auto worker = [ & ]( ) {
+        for ( std::size_t tile; ( tile = next_tile.fetch_add( 1, std::memory_order_relaxed ) ) < tile_count; )
+          draw_tile( tile );
+      };
+
+      const std::size_t worker_count = std::min<std::size_t>( thread_count, tile_count );
+      if ( worker_count <= 1 ) {
+        worker( );
+      } else {
+        std::vector<std::thread> threads;
+        threads.reserve( worker_count - 1 );
+        for ( std::size_t i = 1; i < worker_count; ++i )
+          threads.emplace_back( worker );
+
+        worker( );
+        for ( std::thread & thread : threads )
+          thread.join( );
+      }
+
+      clear( );
+    }
+
+    void clear( ) noexcept {
+      m_primitives.clear( );
+      for ( std::vector<std::uint32_t> & bin : m_bins )
+        bin.clear( );
+    }
+
+  private:
+    // Keep tiles a multiple of the triangle block size.
+    [[nodiscard]] static int round_tile_size( int tile_size ) noexcept {
+      constexpr int block = _nmu_internal::block_size;
+      return block * std::max( 1, ( tile_size + block - 1 ) / block );
+    }
+
+    struct primitive_types {
+      static constexpr int line = 0, line_aa = 1, triangle = 2, circle = 3, circle_filled = 4;
+    };
+
+    struct primitive_t {
+      int           type = primitive_types::line;
+      vec2_t<int>   points[ 3 ];
+      vec2_t<float> points_f[ 2 ];
+      int           radius = 0;
+      color_t       color;
+      int           blend = blend_modes::alpha;
+    };
+
+    primitive_t & push( int type, const color_t & color, int blend ) {
+      primitive_t & primitive = m_primitives.emplace_back( );
+      primitive.type          = type;
+      primitive.color         = color;
+      primitive.blend         = blend;
+      return primitive;
+    }
+
+    void push_circle( int type, const vec2_t<int> & center, int radius, const color_t & color, int blend ) {
+      nmu_assert( _nmu_internal::in_range( center ) && _nmu_internal::in_range( radius ),
+                  "Circle is out of range" );
+
+      primitive_t & primitive = push( type, color, blend );
+      primitive.points[ 0 ]   = center;
+      primitive.radius        = radius;
+
+      if ( radius < 0 )
+        return;
+
+      // Skip tiles wholly outside of the disk and, for outlines, tiles wholly inside of it.
+      const std::int64_t limit = static_cast<std::int64_t>( radius ) * radius + radius;
+      const auto         nearest = []( std::int64_t min, std::int64_t max ) {
+        return min > 0 ? min : max < 0 ? -max : 0;
+      };
+      const auto farthest = []( std::int64_t min, std::int64_t max ) { return std::max( -min, max ); };
+
+      const auto [ first_row, last_row ] = tile_span( center.y - radius, center.y + radius, m_canvas.height );
+      const auto [ first_col, last_col ] = tile_span( center.x - radius, center.x + radius, m_canvas.width );
+      for ( int tile_y = first_row; tile_y <= last_row; ++tile_y ) {
+        for ( int tile_x = first_col; tile_x <= last_col; ++tile_x ) {
+          const _nmu_internal::clip_rect_t tile = tile_rect( tile_x, tile_y );
+
+          const std::int64_t min_x = tile.min_x - center.x, max_x = tile.max_x - 1 - center.x;
+          const std::int64_t min_y = tile.min_y - center.y, max_y = tile.max_y - 1 - center.y;
+
+          const std::int64_t near_x = nearest( min_x, max_x ), near_y = nearest( min_y, max_y );
+          if ( near_x * near_x + near_y * near_y > limit )
+            continue;
+
+          const std::int64_t far_x = farthest( min_x, max_x ), far_y = farthest( min_y, max_y );
+          if ( type == primitive_types::circle && ( far_x + 1 ) * ( far_x + 1 ) + far_y * far_y <= limit &&
+               far_x * far_x + ( far_y + 1 ) * ( far_y + 1 ) <= limit )
+            continue;
+
+          bin_tile( tile_x, tile_y );
+        }
+      }
+    }
+
+    // Tiles along one axis overlapping pixels [min; max], first > last when there are none.
+    [[nodiscard]] std::pair<int, int> tile_span( int min, int max, int size ) const noexcept {
+      min = std::max( min, 0 );
+      max = std::min( max, size - 1 );
+      if ( min > max )
+        return { 1, 0 };
+      return { min / m_tile_size, max / m_tile_size };
+    }
+
+    [[nodiscard]] _nmu_internal::clip_rect_t tile_rect( int tile_x, int tile_y ) const noexcept {
+      _nmu_internal::clip_rect_t rect;
+      rect.min_x = tile_x * m_tile_size;
+      rect.min_y = tile_y * m_tile_size;
+      rect.max_x = std::min( rect.min_x + m_tile_size, m_canvas.width );
+      rect.max_y = std::min( rect.min_y + m_tile_size, m_canvas.height );
+      return rect;
+    }
+
+    // Whole canvas width of a row of tiles.
+    [[nodiscard]] _nmu_internal::clip_rect_t tile_row_rect( int tile_y ) const noexcept {
+      _nmu_internal::clip_rect_t rect = tile_rect( 0, tile_y );
+      rect.max_x                      = m_canvas.width;
+      return rect;
+    }
+
+    // Appends the last primitive to a tile.
+    void bin_tile( int tile_x, int tile_y ) {
+      m_bins[ static_cast<std::size_t>( tile_y ) * m_tiles_x + tile_x ].push_back(
+          static_cast<std::uint32_t>( m_primitives.size( ) - 1 ) );
+    }
+
+    // Appends the last primitive to the tiles of row tile_y overlapping pixel columns [min_x; max_x].
+    void bin_row( int tile_y, int min_x, int max_x ) {
+      const auto [ first_col, last_col ] = tile_span( min_x, max_x, m_canvas.width );
+      for ( int tile_x = first_col; tile_x <= last_col; ++tile_x )
+        bin_tile( tile_x, tile_y );
+    }
+
+    // Appends the last primitive to every tile touched by the inclusive pixel rectangle.
+    void bin( int min_x, int min_y, int max_x, int max_y ) {
+      const auto [ first_row, last_row ] = tile_span( min_y, max_y, m_canvas.height );
+      for ( int tile_y = first_row; tile_y <= last_row; ++tile_y )
+        bin_row( tile_y, min_x, max_x );
+    }
+
+    void draw_tile( std::size_t tile ) const noexcept {
+      const std::vector<std::uint32_t> & bin = m_bins[ tile ];
+      if ( bin.empty( ) )
+        return;
+
+      const _nmu_internal::clip_rect_t clip =
+          tile_rect( static_cast<int>( tile % m_tiles_x ), static_cast<int>( tile / m_tiles_x ) );
+
+      for ( const std::uint32_t index : bin ) {
+        const primitive_t & p = m_primitives[ index ];
+        switch ( p.type ) {
+          case primitive_types::line:
+            _nmu_internal::line( m_canvas, clip, p.points[ 0 ], p.points[ 1 ], p.color, p.blend );
+            break;
+          case primitive_types::line_aa:
+            _nmu_internal::line_aa( m_canvas, clip, p.points_f[ 0 ], p.points_f[ 1 ], p.color );
+            break;
+          case primitive_types::triangle:
+            _nmu_internal::triangle(
+                m_canvas, clip, p.points[ 0 ], p.points[ 1 ], p.points[ 2 ], p.color, p.blend );
+            break;
+          case primitive_types::circle:
+            _nmu_internal::circle( m_canvas, clip, p.points[ 0 ], p.radius, p.color, p.blend );
+            break;
+          case primitive_types::circle_filled:
+            _nmu_internal::circle_filled( m_canvas, clip, p.points[ 0 ], p.radius, p.color, p.blend );
+            break;
+          default: break;
+        }
+      }
+    }
+
+    canvas_t                                m_canvas;
+    int                                     m_tile_size, m_tiles_x, m_tiles_y;
+    std::vector<primitive_t>                m_primitives;
+    std::vector<std::vector<std::uint32_t>> m_bins;
+  };
+} // namespace nmu
+
+#endif // NMU_RASTER_HPP